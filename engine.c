@@ -24,8 +24,9 @@
 //
 struct Event {
     double timestamp;		// event timestamp
+    unsigned long seq;		// order in which the event was scheduled, used to break timestamp ties
+    int heapIndex;			// position of the event in the FEL heap array
     void *AppData;			// pointer to application defined event parameters
-    struct Event *Next;		// priority queue pointer
 };
 
 
@@ -34,12 +35,13 @@ double Now = 0.0;
 
 
 // Future Event List
-// Use an event structure as the header for the future event list (priority queue)
-// Using an event struct as the header for the priority queue simplifies the code for
-// inserting/removing events by eliminating the need to explicitly code special cases
-// such as inserting into an empty priority queue, or removing the last event in the priority queue.
-// See the Remove() and Schedule() functions below.
-struct Event FEL ={-1.0, NULL, NULL};
+// The priority queue is a binary heap stored in a dynamically grown array of event pointers.
+// Each event records its own position in the array (heapIndex), so an event can be removed from
+// the middle of the heap in O(log n) time when it is cancelled. See Schedule(), Remove() and Cancel().
+struct Event **FEL = NULL;
+int FELSize = 0;			// number of events in the FEL
+int FELCapacity = 0;		// number of event pointers allocated for the FEL
+unsigned long NextSeq = 0;	// sequence number given to the next scheduled event
 
 
 
@@ -53,6 +55,16 @@ struct Event *Remove (void);
 // Function to print timestamps of events in event list
 void PrintList (void);
 
+// Returns nonzero if event a must be processed before event b
+int Before (struct Event *a, struct Event *b);
+
+// Store event e at position i of the FEL heap
+void Place (struct Event *e, int i);
+
+// Restore the heap order by moving the event at position i toward the root or the leaves
+void SiftUp (int i);
+void SiftDown (int i);
+
 
 
 
@@ -61,26 +73,70 @@ void PrintList (void);
 // Simulation Engine Functions Internal to this module
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Events with equal timestamps are processed most recently scheduled first, the same order
+// the original timestamp ordered linear list produced
+int Before (struct Event *a, struct Event *b)
+{
+    if (a->timestamp != b->timestamp) return (a->timestamp < b->timestamp);
+    return (a->seq > b->seq);
+}
+
+void Place (struct Event *e, int i)
+{
+    FEL[i] = e;
+    e->heapIndex = i;
+}
+
+void SiftUp (int i)
+{
+    struct Event *e = FEL[i];
+
+    while (i > 0 && Before (e, FEL[(i-1)/2])) {
+        Place (FEL[(i-1)/2], i);
+        i = (i-1)/2;
+    }
+    Place (e, i);
+}
+
+void SiftDown (int i)
+{
+    struct Event *e = FEL[i];
+    int child;
+
+    while ((child = 2*i+1) < FELSize) {
+        if (child+1 < FELSize && Before (FEL[child+1], FEL[child])) child++;
+        if (!Before (FEL[child], e)) break;
+        Place (FEL[child], i);
+        i = child;
+    }
+    Place (e, i);
+}
+
 // Remove smallest timestamped event from FEL, return pointer to this event
 // return NULL if FEL is empty
 struct Event *Remove (void)
 {
     struct Event *e;
 
-    if (FEL.Next==NULL) return (NULL);
-    e = FEL.Next;		// remove first event in list
-    FEL.Next = e->Next;
+    if (FELSize==0) return (NULL);
+    e = FEL[0];		// remove root of the heap
+    FELSize--;
+    if (FELSize > 0) {
+        Place (FEL[FELSize], 0);
+        SiftDown (0);
+    }
     return (e);
 }
 
 // Print timestamps of all events in the event list (used for debugging)
+// Events are printed in heap order, not timestamp order
 void PrintList (void)
 {
-    struct Event *p;
+    int i;
 
     printf ("Event List: ");
-    for (p=FEL.Next; p!=NULL; p=p->Next) {
-        printf ("%f ", p->timestamp);
+    for (i=0; i<FELSize; i++) {
+        printf ("%f ", FEL[i]->timestamp);
     }
     printf ("\n");
 }
@@ -97,8 +153,9 @@ void PrintList (void)
 // for each event put into the event list. The Schedule function allocates this memory.
 // This memory is released after the event is processed (in RunSim), i.e., after the event handler
 // for the event has been called and completes execution.
-// Because we know each event is scheduled exactly once, and is processed exactly once, we know that
-// memory dynamically allocated (using malloc) for each event will be released exactly once (using free).
+// Because we know each event is scheduled exactly once, and is either processed or cancelled exactly once,
+// we know that memory dynamically allocated (using malloc) for each event will be released exactly once
+// (using free), either in RunSim or in Cancel.
 // Similarly, the simulation application (not shown here) is responsible for reclaiming all memory
 // it dynamically allocates, but does not release any memory allocated by the simulation engine.
 //
@@ -109,26 +166,46 @@ double CurrentTime (void)
     return (Now);
 }
 
-// Schedule new event in FEL
-// queue is implemented as a timestamp ordered linear list
+// Schedule new event in FEL, return a handle that may be passed to Cancel
+// queue is implemented as a binary heap
 
-void Schedule (double ts, void *data)
+EventHandle Schedule (double ts, void *data)
 {
-    struct Event *e, *p, *q;
+    struct Event *e;
 
     // create event data structure and fill it in
     if ((e = malloc (sizeof (struct Event))) == NULL) exit(1);
     e->timestamp = ts;
+    e->seq = NextSeq++;
     e->AppData = data;
 
+    // grow the heap array if it is full
+    if (FELSize == FELCapacity) {
+        FELCapacity = FELCapacity == 0 ? 64 : 2*FELCapacity;
+        if ((FEL = realloc (FEL, FELCapacity * sizeof (struct Event *))) == NULL) exit(1);
+    }
+
     // insert into priority queue
-    // p is lead pointer, q is trailer
-    for (q=&FEL, p=FEL.Next; p!=NULL; p=p->Next, q=q->Next) {
-        if (p->timestamp >= e->timestamp) break;
+    Place (e, FELSize++);
+    SiftUp (e->heapIndex);
+    return (e);
+}
+
+// Remove a scheduled event from the FEL before it is processed, return its event parameters
+// The event is removed immediately, so cancelled events never occupy space in the FEL
+void *Cancel (EventHandle e)
+{
+    void *data = e->AppData;
+    int i = e->heapIndex;
+
+    FELSize--;
+    if (i < FELSize) {
+        Place (FEL[FELSize], i);
+        if (i > 0 && Before (FEL[i], FEL[(i-1)/2])) SiftUp (i);
+        else SiftDown (i);
     }
-    // insert after q (before p)
-    e->Next = q->Next;
-    q->Next = e;
+    free (e);
+    return (data);
 }
 
 // Function to execute simulation up to a specified time (EndTime)
@@ -25,6 +25,7 @@ double EndTime = -1;
 
 int customerIDiterator = 0; // Number of customers in the system
 int customersExited = 0; // Number of customers which have left the system
+int customersReneged = 0; // Number of customers which abandoned a queue before being served
 double minTime = INFINITY;
 double maxTime = 0;
 double avgTime = 0;
@@ -33,10 +34,17 @@ double maxWaitTime = 0;
 double avgWaitTime = 0;
 int numComponents;
 
+// Infinitesimal perturbation analysis (IPA) of service-time sensitivities
+// When enabled, every customer carries the derivatives of its event times with respect to the mean
+// service time P of each station, so one run yields d(wait)/dP and d(system time)/dP for all stations.
+int ipaEnabled = 0;
+double *dSystemTimeSum = NULL; // sum over exited customers of d(system time)/dP, indexed by station ID
+
 
 // Event types
 #define	ARRIVAL     1
 #define	DEPARTURE   2
+#define	RENEGE      3
 
 
 
@@ -55,7 +63,7 @@ int numComponents;
 // the number and type of the parameters, so this information is hidden from the engine. The simulation
 // engine is only given a pointer to event parameters.
 // For this simple application, events only have one parameter, indicating the kind of event
-// (ARRIVAL or DEPARTURE)
+// (ARRIVAL, DEPARTURE or RENEGE)
 
 struct EventData {
     int EventType;
@@ -73,7 +81,11 @@ struct customer {
     double queueArrivalTime;
     double waitingTime;
     double serviceTime;
+    double *dArrival; // IPA: derivative of queueArrivalTime (or exitTime) w.r.t. each station's P
+    double *dDeparture; // IPA: derivative of the departure time from the current station
+    EventHandle renegeHandle; // pending RENEGE event while waiting in line, NULL otherwise
     struct customer *Next; //next in line
+    struct customer *Prev; //previous in line
     struct customer *NextAll; //next customer that exists overall
 };
 
@@ -97,6 +109,9 @@ typedef struct station {
     double maxWait;
     double avgWait;
     int processedCustomers;
+    double patience; // average time a customer waits in line before reneging, 0 if customers never renege
+    int renegedCustomers;
+    double *dWaitSum; // IPA: sum over processed customers of d(wait)/dP, indexed by station ID
 } station;
 
 
@@ -119,6 +134,7 @@ struct customerQueue *customers;
 // prototypes for event handlers
 void Arrival (struct EventData *e);		// arrival event
 void Departure (struct EventData *e);	// departure event
+void Renege (struct EventData *e);		// customer abandons the queue
 
 
 
@@ -134,12 +150,23 @@ void createGenerator(double P, int D);
 void createExit(int ID);
 
 // Creates a queueing station with ID ID and average queueing time P, it sends customers
-// to destinations with given probabilities.
-void createStation(int ID, double P, double *probabilities, int *destinations);
+// to destinations with given probabilities. Waiting customers renege after an average time patience,
+// or never if patience is 0.
+void createStation(int ID, double P, double *probabilities, int *destinations, double patience);
 
 // This function writes to outputFilename the results of the simulation
 void writeResults(char *outputFilename);
 
+// Writes the IPA estimates of d(average wait)/dP and d(average system time)/dP to ofp
+void writeSensitivities(FILE *ofp);
+
+// Allocates a zeroed array of IPA derivatives, one entry per component
+double *newDerivatives(void);
+
+// IPA: sets the departure time derivatives of a customer starting service at station componentID,
+// given the derivatives dStart of its service start time and its sampled service time
+void startServiceIPA(struct customer *customerPtr, double *dStart, int componentID, double serviceTime);
+
 // Returns a random number corresponding to the exponential distribution with parameter lambda
 double randexp(double lambda);
 
@@ -204,7 +231,17 @@ void readConfig(char *configFilename) {
             for (int j = 0; j < numRoutes; j++) {
                 fscanf(ifp,"%d",&destinations[j]);
             }
-            createStation(id,avgServiceTime,probs,destinations);
+            // an optional average patience may follow the destinations on the same line
+            double patience = 0;
+            char rest[100];
+            if (fgets(rest,sizeof(rest),ifp) != NULL) {
+                sscanf(rest,"%lf",&patience);
+            }
+            if (patience < 0) {
+                fprintf(stderr,"Error: the patience of station %d must not be negative!\n", id);
+                exit(1);
+            }
+            createStation(id,avgServiceTime,probs,destinations,patience);
         }
         else {
             fprintf(stderr,"Error: One of the component types is invalid.  Component types should be one of G, "
@@ -229,6 +266,27 @@ double urand(){
 }
 
 
+double *newDerivatives(void) {
+    double *derivatives = (double *)calloc(numComponents, sizeof(double));
+    if (derivatives == NULL) {fprintf(stderr, "malloc error\n"); exit(1);}
+    return derivatives;
+}
+
+
+// A service time drawn by randexp(P) is S = -P*log(1-u), so dS/dP = S/P for the serving station and 0 for
+// every other station.  Service starts either on arrival at an idle station or on the departure of the
+// previous customer, and the caller passes the derivatives of whichever of those times applies.
+void startServiceIPA(struct customer *customerPtr, double *dStart, int componentID, double serviceTime) {
+    double P = stations[componentID]->P;
+    for (int j = 0; j < numComponents; j++) {
+        customerPtr->dDeparture[j] = dStart[j];
+    }
+    if (P > 0) {
+        customerPtr->dDeparture[componentID] += serviceTime / P;
+    }
+}
+
+
 
 void createGenerator(double P, int D) {
     double total_time = 0.0;
@@ -242,10 +300,14 @@ void createGenerator(double P, int D) {
             new_customer->entryTime = total_time;
             new_customer->exitTime = -1;
             new_customer->Next = NULL;
+            new_customer->Prev = NULL;
             new_customer->NextAll = NULL;
+            new_customer->renegeHandle = NULL;
             new_customer->ID = ++customerIDiterator;
             new_customer->waitingTime = 0;
             new_customer->serviceTime = 0;
+            new_customer->dArrival = ipaEnabled ? newDerivatives() : NULL;
+            new_customer->dDeparture = ipaEnabled ? newDerivatives() : NULL;
             new_event->EventType = ARRIVAL;
             new_event->componentID = D;
             new_event->customerPtr = new_customer;
@@ -279,7 +341,7 @@ void createExit(int ID) {
 }
 
 
-void createStation(int ID, double P, double *probabilities, int *destinations) {
+void createStation(int ID, double P, double *probabilities, int *destinations, double patience) {
     struct customerQueue *line = (struct customerQueue *)malloc(sizeof(struct customerQueue));
     line->first = NULL;
     line->last = NULL;
@@ -295,6 +357,9 @@ void createStation(int ID, double P, double *probabilities, int *destinations) {
     new_station->minWait = INFINITY;
     new_station->avgWait = -1;
     new_station->processedCustomers = 0;
+    new_station->patience = patience;
+    new_station->renegedCustomers = 0;
+    new_station->dWaitSum = ipaEnabled ? newDerivatives() : NULL;
     stations[ID] = new_station;
 }
 
@@ -332,6 +397,9 @@ void writeResults(char *outputFilename) {
     }
     fprintf(ofp, "During the simulation, %d customers entered the system, and %d exited the system.\n",
             customerIDiterator, customersExited);
+    if (customersReneged > 0) {
+        fprintf(ofp, "%d customers reneged, leaving a queue before being served.\n", customersReneged);
+    }
     if (customersExited <= 0) {
         fprintf(ofp,"During the simulation, no customers exited the system, so there are no\nstatistics for the"
                 " total amount of time customers spent in the system.\n");
@@ -355,15 +423,48 @@ void writeResults(char *outputFilename) {
                     fprintf(ofp,"For queue with ID %d, the average waiting time is %f.\n", i,
                             stations[i]->avgWait > 0 ? stations[i]->avgWait : 0);
                 }
+                if (stations[i]->patience > 0) {
+                    fprintf(ofp,"For queue with ID %d, %d customers reneged.\n", i,
+                            stations[i]->renegedCustomers);
+                }
             }
         }
     }
+    if (ipaEnabled) {
+        writeSensitivities(ofp);
+    }
 
 
     fclose(ofp);
 }
 
 
+void writeSensitivities(FILE *ofp) {
+    int i, j;
+    fprintf(ofp, "\nIPA sensitivities with respect to the average service time P of each queue:\n");
+    if (customersExited <= 0) {
+        fprintf(ofp, "No customers exited the system, so there is no estimate for the time spent in the system.\n");
+    } else {
+        for (j = 0; j < numComponents; j++) {
+            if (stations[j]->isExit == 0) {
+                fprintf(ofp, "d(average time in system)/dP of queue %d is %f.\n", j,
+                        dSystemTimeSum[j] / (double)customersExited);
+            }
+        }
+    }
+    for (i = 0; i < numComponents; i++) {
+        if (stations[i]->isExit == 0 && stations[i]->processedCustomers > 0) {
+            for (j = 0; j < numComponents; j++) {
+                if (stations[j]->isExit == 0) {
+                    fprintf(ofp, "d(average waiting time of queue %d)/dP of queue %d is %f.\n", i, j,
+                            stations[i]->dWaitSum[j] / (double)stations[i]->processedCustomers);
+                }
+            }
+        }
+    }
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Event Handlers
@@ -383,6 +484,7 @@ void EventHandler (void *data)
     // call an event handler based on the type of event
     if (d->EventType == ARRIVAL) Arrival (d);
     else if (d->EventType == DEPARTURE) Departure (d);
+    else if (d->EventType == RENEGE) Renege (d);
     else {fprintf (stderr, "Illegal event found\n"); exit(1); }
     free(d);
 }
@@ -408,6 +510,11 @@ void Arrival (struct EventData *e)
         minTime = minTime < customerSystemTime ? minTime : customerSystemTime;
         avgTime = ((avgTime * (double)customersExited)+customerSystemTime) / ((double)customersExited+1);
         customersExited += 1;
+        if (ipaEnabled) {
+            for (int j = 0; j < numComponents; j++) {
+                dSystemTimeSum[j] += customerPtr->dArrival[j];
+            }
+        }
 
     } else if (curStation->isExit == 0) {
         //printf ("Processing Arrival event at time %f of customer %d in queue %d which now has %d in line\n",
@@ -423,13 +530,30 @@ void Arrival (struct EventData *e)
             d->componentID = componentID;
             double serviceTime = randexp(curStation->P);
             d->customerPtr->serviceTime = serviceTime;
+            if (ipaEnabled) {
+                startServiceIPA(customerPtr, customerPtr->dArrival, componentID, serviceTime);
+            }
             ts = CurrentTime() + serviceTime;
             Schedule(ts, d);
+            customerPtr->Next = NULL;
+            customerPtr->Prev = NULL;
             curStation->line->first = customerPtr;
             curStation->line->last = customerPtr;
         } else {
+            customerPtr->Next = NULL;
+            customerPtr->Prev = curStation->line->last;
             curStation->line->last->Next = customerPtr;
             curStation->line->last = customerPtr;
+            if (curStation->patience > 0) {
+                // schedule reneging event, cancelled if the customer starts service first
+                struct EventData *d;
+                if((d=malloc(sizeof(struct EventData)))==NULL) {fprintf(stderr, "malloc error\n"); exit(1);}
+                d->EventType = RENEGE;
+                d->customerPtr = customerPtr;
+                d->componentID = componentID;
+                ts = CurrentTime() + randexp(curStation->patience);
+                customerPtr->renegeHandle = Schedule(ts, d);
+            }
         }
     }
 }
@@ -458,6 +582,17 @@ void Departure (struct EventData *e)
     curStation->avgWait = ((curStation->avgWait * (double)curStation->processedCustomers)+customerQueueTime) /
             ((double)curStation->processedCustomers+1);
     curStation->processedCustomers++;
+    if (ipaEnabled) {
+        // waiting time is departure - arrival - service, and the customer arrives at its next
+        // component at the instant it departs this one
+        for (int j = 0; j < numComponents; j++) {
+            curStation->dWaitSum[j] += customerPtr->dDeparture[j] - customerPtr->dArrival[j];
+            customerPtr->dArrival[j] = customerPtr->dDeparture[j];
+        }
+        if (curStation->P > 0) {
+            curStation->dWaitSum[componentID] -= customerPtr->serviceTime / curStation->P;
+        }
+    }
 
 
     // schedule arrival of customer leaving the queue
@@ -479,11 +614,50 @@ void Departure (struct EventData *e)
         d->componentID = componentID;
         double serviceTime = randexp(curStation->P);
         d->customerPtr->serviceTime = serviceTime;
+        if (ipaEnabled) {
+            startServiceIPA(d->customerPtr, customerPtr->dDeparture, componentID, serviceTime);
+        }
         ts = CurrentTime() + serviceTime;
         Schedule(ts, d);
         curStation->line->first->waitingTime += CurrentTime() - curStation->line->first->queueArrivalTime;
+        curStation->line->first->Prev = NULL;
+        if (curStation->line->first->renegeHandle != NULL) {
+            free(Cancel(curStation->line->first->renegeHandle));
+            curStation->line->first->renegeHandle = NULL;
+        }
+    }
+
+}
+
+
+
+// event handler for reneging events
+// The customer is never first in line, since the first customer is in service and has no pending RENEGE
+void Renege (struct EventData *e)
+{
+    int componentID = e->componentID;
+    struct customer *customerPtr = e->customerPtr;
+    station *curStation = stations[componentID];
+
+    if (e->EventType != RENEGE) {fprintf (stderr, "Unexpected event type\n"); exit(1);}
+
+    //printf ("Processing Renege event at time %f of customer %d in queue %d which now has %d in line\n",
+            //CurrentTime(), customerPtr->ID, componentID, --(curStation->inQueue));
+    curStation->inQueue--;
+
+    // remove customer from the line
+    customerPtr->Prev->Next = customerPtr->Next;
+    if (customerPtr->Next != NULL) {
+        customerPtr->Next->Prev = customerPtr->Prev;
+    } else {
+        curStation->line->last = customerPtr->Prev;
     }
+    customerPtr->renegeHandle = NULL;
 
+    // update stats
+    customerPtr->waitingTime += CurrentTime() - customerPtr->queueArrivalTime;
+    curStation->renegedCustomers++;
+    customersReneged++;
 }
 
 
@@ -499,7 +673,19 @@ int main(int argc, char* argv[]) {
     EndTime = strtof(argv[1], NULL);
     char *configFilename = argv[2];
     char *outputFilename = argv[3];
+    if (argc > 4 && strcmp(argv[4], "-ipa") == 0) {
+        ipaEnabled = 1;
+    }
     readConfig(configFilename);
+    if (ipaEnabled) {
+        dSystemTimeSum = newDerivatives();
+        for (int i = 0; i < numComponents; i++) {
+            if (stations[i]->isExit == 0 && stations[i]->patience > 0) {
+                fprintf(stderr,"Warning: IPA sensitivities do not account for reneging customers.\n");
+                break;
+            }
+        }
+    }
     RunSim(EndTime);
     writeResults(outputFilename);
     return(0);
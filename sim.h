@@ -23,8 +23,16 @@
 // Call this procedure to run the simulation indicating time to end simulation
 void RunSim (double EndTime);
 
+// Handle identifying a scheduled event, returned by Schedule
+typedef struct Event *EventHandle;
+
 // Schedule an event with timestamp ts, event parameters *data
-void Schedule (double ts, void *data);
+// The returned handle may be ignored, or kept to cancel the event later
+EventHandle Schedule (double ts, void *data);
+
+// Cancel an event that has been scheduled but not yet processed, in O(log n) time
+// Returns the event parameters so the application can free them
+void *Cancel (EventHandle e);
 
 // This function returns the current simulation time
 double CurrentTime (void);